@@ -0,0 +1,246 @@
+// oit_compare - renders the same reference scene with the sorted alpha
+// blending path and with the weighted blended OIT path, then diffs them.
+//
+// Runs headless on Mesa's software rasterizer (EGL surfaceless + llvmpipe):
+//
+//      g++ -std=c++17 -I examples/oit_compare examples/oit_compare/main.cpp -o oit_compare -lEGL -lOpenGL
+//      EGL_PLATFORM=surfaceless ./oit_compare sample_shaders
+//
+// Writes sorted.ppm, oit.ppm and diff.ppm (absolute difference x4) to the
+// working directory and prints the error statistics.
+
+#define STB_PARTICLE_SYSTEM_IMPLEMENTATION
+#include "../../stb_particle_system.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+static const int WIDTH = 256, HEIGHT = 256;
+
+static std::string readFile(const std::string& path){
+    std::ifstream file(path);
+    std::stringstream ss;
+    ss << file.rdbuf();
+    return ss.str();
+}
+
+static unsigned int compileShader(GLenum type, std::string source){
+    // llvmpipe exposes GL 4.5, sample.frag uses nothing from GLSL 4.60
+    size_t version = source.find("#version 460");
+    if( version != std::string::npos )
+        source.replace(version, 12, "#version 450");
+
+    const char* src = source.c_str();
+    unsigned int shader = glCreateShader(type);
+    glShaderSource(shader, 1, &src, nullptr);
+    glCompileShader(shader);
+
+    GLint ok;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if( !ok ){
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+        std::cerr << "shader compilation failed\n" << log << std::endl;
+        exit(1);
+    }
+    return shader;
+}
+
+static unsigned int linkProgram(const std::string& vert_path, const std::string& frag_path){
+    unsigned int vert = compileShader(GL_VERTEX_SHADER, readFile(vert_path));
+    unsigned int frag = compileShader(GL_FRAGMENT_SHADER, readFile(frag_path));
+
+    unsigned int program = glCreateProgram();
+    glAttachShader(program, vert);
+    glAttachShader(program, frag);
+    glLinkProgram(program);
+
+    GLint ok;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if( !ok ){
+        char log[1024];
+        glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+        std::cerr << "program link failed\n" << log << std::endl;
+        exit(1);
+    }
+
+    glDeleteShader(vert);
+    glDeleteShader(frag);
+    return program;
+}
+
+static void readPixels(std::vector<unsigned char>& pixels){
+    pixels.resize(WIDTH * HEIGHT * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+}
+
+static void writePPM(const char* path, const std::vector<unsigned char>& pixels){
+    std::ofstream file(path, std::ios::binary);
+    file << "P6\n" << WIDTH << " " << HEIGHT << "\n255\n";
+    for(int y = HEIGHT - 1; y >= 0; y--)
+        file.write((const char*) &pixels[y * WIDTH * 3], WIDTH * 3);
+}
+
+static void setupSystem(ParticleSystem& system, unsigned int VAO, glm::vec3 position, glm::vec4 color, bool oit_mode){
+    system.setOITMode(oit_mode);
+    system.attatchVAO(VAO, 6, GL_UNSIGNED_INT, nullptr);
+
+    ParticleProps* props = system.getPropsReference();
+    props->position = position;
+    props->velocity = glm::vec3(0.f, 0.1f, 0.f);
+    props->velocity_variation = glm::vec3(0.6f, 0.4f, 0.2f);
+    props->color_begin = color;
+    props->color_end = glm::vec4(color.r, color.g, color.b, 0.2f);
+    props->size_begin = 0.25f;
+    props->size_end = 0.1f;
+    props->life_time = 2.f;
+    *system.getSpawnRateReference() = 0.01f;
+    system.commitParams();
+}
+
+// Reference scene: two overlapping emitters, warm behind cold. Each one only
+// spreads +-0.2 in depth, so every warm particle is farther than every cold
+// one and drawing warm then cold, each sorted, is exact back-to-front.
+static void simulateScene(ParticleSystem& warm, ParticleSystem& cold, unsigned int VAO, bool oit_mode){
+    srand(1);
+    setupSystem(warm, VAO, glm::vec3(-0.2f, -0.3f, 0.5f), glm::vec4(1.f, 0.5f, 0.1f, 0.6f), oit_mode);
+    setupSystem(cold, VAO, glm::vec3(0.2f, -0.3f, -0.5f), glm::vec4(0.1f, 0.4f, 1.f, 0.6f), oit_mode);
+
+    // With the identity projection the viewer sits at -z, larger z is farther.
+    // onUpdate sorts by ascending distance to the position it is given, so
+    // pass a point behind the scene to get the pool ordered far to near.
+    glm::vec3 sort_origin(0.f, 0.f, 2.f);
+
+    for(int frame = 0; frame < 240; frame++){
+        warm.onUpdate(1.f / 60.f, sort_origin);
+        cold.onUpdate(1.f / 60.f, sort_origin);
+    }
+}
+
+int main(int argc, char** argv){
+    std::string shader_dir = argc > 1 ? argv[1] : "sample_shaders";
+
+    PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    EGLDisplay display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if( display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr) ){
+        std::cerr << "no EGL display" << std::endl;
+        return 1;
+    }
+
+    eglBindAPI(EGL_OPENGL_API);
+    EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 5,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, context_attribs);
+    if( context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context) ){
+        std::cerr << "no OpenGL 4.5 core context" << std::endl;
+        return 1;
+    }
+    printf("%s | %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+
+    unsigned int sorted_shader = linkProgram(shader_dir + "/sample_oit.vert", shader_dir + "/sample.frag");
+    unsigned int oit_shader = linkProgram(shader_dir + "/sample_oit.vert", shader_dir + "/sample_oit.frag");
+    unsigned int composite_shader = linkProgram(shader_dir + "/oit_composite.vert", shader_dir + "/oit_composite.frag");
+
+    // target framebuffer, there is no default one without a surface
+    unsigned int target_FBO, target_texture;
+    glGenTextures(1, &target_texture);
+    glBindTexture(GL_TEXTURE_2D, target_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, WIDTH, HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glGenFramebuffers(1, &target_FBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, target_FBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target_texture, 0);
+    glViewport(0, 0, WIDTH, HEIGHT);
+
+    // unit quad
+    float vertices[] = { -0.5f, -0.5f, 0.f,  0.5f, -0.5f, 0.f,  0.5f, 0.5f, 0.f,  -0.5f, 0.5f, 0.f };
+    unsigned int indices[] = { 0, 1, 2, 2, 3, 0 };
+    unsigned int VAO, VBO, EBO;
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(0);
+    glBindVertexArray(0);
+
+    // the same seed gives both pairs the same particles, only the OIT pair
+    // runs the sort-free onUpdate
+    ParticleSystem warm, cold, oit_warm, oit_cold;
+    simulateScene(warm, cold, VAO, false);
+    simulateScene(oit_warm, oit_cold, VAO, true);
+
+    glm::mat4 proj_view(1.f);
+
+    std::vector<unsigned char> sorted, oit, diff;
+
+    // sorted path, back to front
+    glClearColor(0.2f, 0.2f, 0.2f, 1.f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    warm.onRender(sorted_shader, proj_view);
+    cold.onRender(sorted_shader, proj_view);
+    readPixels(sorted);
+
+    // OIT path, unsorted
+    ParticleOITBuffer oit_buffer;
+    if( !oit_buffer.create(WIDTH, HEIGHT) )
+        return 1;
+
+    glClear(GL_COLOR_BUFFER_BIT);
+    oit_buffer.begin();
+    oit_warm.onRender(oit_shader, proj_view);
+    oit_cold.onRender(oit_shader, proj_view);
+    oit_buffer.end();
+    oit_buffer.composite(composite_shader);
+    readPixels(oit);
+
+    GLint blend_src, blend_dst;
+    glGetIntegerv(GL_BLEND_SRC_RGB, &blend_src);
+    glGetIntegerv(GL_BLEND_DST_RGB, &blend_dst);
+    bool state_restored = glIsEnabled(GL_BLEND) && blend_src == GL_SRC_ALPHA && blend_dst == GL_ONE_MINUS_SRC_ALPHA;
+
+    diff.resize(sorted.size());
+    double total = 0.0;
+    int max_error = 0, over_threshold = 0;
+    for(size_t i = 0; i < sorted.size(); i++){
+        int error = std::abs((int) sorted[i] - (int) oit[i]);
+        total += error;
+        max_error = std::max(max_error, error);
+        diff[i] = (unsigned char) std::min(255, error * 4);
+    }
+    for(size_t i = 0; i < sorted.size(); i += 3)
+        if( std::max(diff[i], std::max(diff[i+1], diff[i+2])) > 32 )
+            over_threshold++;
+
+    writePPM("sorted.ppm", sorted);
+    writePPM("oit.ppm", oit);
+    writePPM("diff.ppm", diff);
+
+    GLenum gl_error = glGetError();
+    printf("GL error: %u\n", gl_error);
+    printf("blend state restored: %s\n", state_restored ? "yes" : "no");
+    printf("mean abs error: %.2f / 255\n", total / sorted.size());
+    printf("max abs error: %d / 255\n", max_error);
+    printf("pixels off by more than 8: %.2f%%\n", 100.0 * over_threshold / (WIDTH * HEIGHT));
+
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(display, context);
+    eglTerminate(display);
+
+    return gl_error == GL_NO_ERROR && state_restored ? 0 : 1;
+}
@@ -0,0 +1,22 @@
+#version 450 core
+
+uniform sampler2D u_Accum;
+uniform sampler2D u_Revealage;
+
+out vec4 fragColor;
+
+void main(){
+    ivec2 coords = ivec2(gl_FragCoord.xy);
+
+    float revealage = texelFetch(u_Revealage, coords, 0).r;
+    if (revealage >= 1.0)
+        discard;
+
+    vec4 accum = texelFetch(u_Accum, coords, 0);
+    if (isinf(max(max(abs(accum.r), abs(accum.g)), abs(accum.b))))
+        accum.rgb = vec3(accum.a);
+
+    vec3 average_color = accum.rgb / max(accum.a, 1e-5);
+
+    fragColor = vec4(average_color, 1.0 - revealage);
+}
@@ -0,0 +1,9 @@
+#version 460 core
+
+in vec4 v_Color;
+
+out vec4 fragColor;
+
+void main(){
+    fragColor = v_Color; 
+}
@@ -0,0 +1,29 @@
+#version 460 core
+
+layout (location = 0) in vec3 a_Pos;
+
+struct Instance {
+    mat4 transform;
+    vec4 color;
+    vec4 size;
+};
+
+struct Emitter {
+    uint instance_base;
+    uint instance_count;
+    uint padding0;
+    uint padding1;
+};
+
+layout (std430, binding = 0) readonly buffer Instances { Instance u_Instances[]; };
+layout (std430, binding = 1) readonly buffer Emitters { Emitter u_Emitters[]; };
+
+uniform mat4 u_ProjView;
+
+out vec4 v_Color;
+
+void main() {
+    Instance instance = u_Instances[u_Emitters[gl_DrawID].instance_base + gl_InstanceID];
+    v_Color = instance.color;
+    gl_Position = u_ProjView * instance.transform * vec4(a_Pos.x , a_Pos.y, a_Pos.z, 1.0);
+}
@@ -0,0 +1,15 @@
+#version 450 core
+
+uniform vec4 u_Color;
+
+layout (location = 0) out vec4 accum;
+layout (location = 1) out float revealage;
+
+void main(){
+    // depth weight after McGuire & Bavoil, the 1e8 scaled variant saturates
+    // at the upper clamp for any alpha above ~0.1 and loses the depth cue
+    float weight = clamp(3e3 * pow(1.0 - gl_FragCoord.z, 3.0), 1e-2, 3e3);
+
+    accum = vec4(u_Color.rgb * u_Color.a, u_Color.a) * weight;
+    revealage = u_Color.a;
+}
@@ -14,6 +14,7 @@
 //      vector
 //      cstdlib     rand, srand
 //      ctime       time
+//      atomic      live editing of the emitter properties
 //
 // External libraries:
 // 
@@ -41,6 +42,8 @@
 #include <unordered_map>
 #include <sstream>
 #include <iomanip>
+#include <atomic>
+#include <cstdint>
 
 #define RANDOM_VAL ((float) rand() / RAND_MAX) // random float between 0 and 1
 
@@ -195,6 +198,12 @@ enum PSenum{
     PS_DRAW_ELEMENTS_BASE_VERTEX
 };
 
+enum PSevent{
+    PS_EVENT_SPAWN,
+    PS_EVENT_DEATH,
+    PS_EVENT_COLLISION
+};
+
 class ParticleSystem{
 
 public:
@@ -215,6 +224,29 @@ public:
         bool active = false;
     };
 
+    // Something that happened to a particle during the last onUpdate
+    struct ParticleEvent{
+        glm::vec3 position;
+        glm::vec3 velocity;
+    };
+
+    // Everything an editor can tune while the system is running
+    struct EmitterParams{
+        ParticleProps props;
+        float spawn_rate = 3.f, spawn_rate_variation = 0.f;
+        float reproduction_speed = 1.f;
+        float point_size = 1.f;
+        uint32_t version = 0;
+    };
+
+    // Emits count particles in target for every event of the trigger type
+    struct SubEmitter{
+        ParticleSystem* target = nullptr;
+        PSevent trigger = PS_EVENT_DEATH;
+        ParticleProps props; // props.position is an offset from the event position
+        int count = 1;
+    };
+
 private:
 
     GLenum blendFactors[10] = {
@@ -246,6 +278,50 @@ private:
     bool acceleration_active = true;
     float reproduction_speed = 1.f;
 
+    // Live editing, the fields above are the live copy and only onUpdate
+    // writes them. The editor writes edit_params (through the get*Reference
+    // pointers) and commitParams() publishes it through a lock free triple
+    // buffer: the editor owns slots[back_slot], onUpdate owns
+    // slots[front_slot] and middle_slot is swapped atomically.
+    // std::atomic is not copyable, the explicit copy keeps ParticleSystem
+    // copyable and movable. Copying is not thread safe, like the rest of it.
+    struct ParamsExchange{
+        EmitterParams slots[3];
+        int back_slot = 0, front_slot = 2;
+        std::atomic<int> middle_slot{1};
+        std::atomic<uint32_t> applied_version{0}; // written by onUpdate, read by the editor
+
+        ParamsExchange(){}
+        ParamsExchange(const ParamsExchange& other){ *this = other; }
+        ParamsExchange& operator=(const ParamsExchange& other){
+            for(int i = 0; i < 3; i++)
+                slots[i] = other.slots[i];
+            back_slot = other.back_slot;
+            front_slot = other.front_slot;
+            middle_slot.store(other.middle_slot.load());
+            applied_version.store(other.applied_version.load());
+            return *this;
+        }
+    };
+
+    EmitterParams edit_params;
+    ParamsExchange params_exchange;
+    static const int PARAMS_FRESH = 4; // set in middle_slot when it holds an unread commit
+
+    // events are batched per frame and only recorded once something reads
+    // them (getEvents or addSubEmitter). The buffers are then reserved to the
+    // pool size and never grow, events past that in a single frame are dropped.
+    // The dispatched_* buffers hold last frame events while sub emitters run.
+    bool events_enabled = false;
+    std::vector<ParticleEvent> spawn_events, death_events, collision_events;
+    std::vector<ParticleEvent> dispatched_spawn_events, dispatched_death_events, dispatched_collision_events;
+    std::vector<SubEmitter> sub_emitters;
+
+    // collision against the plane dot(collision_normal, p) = collision_offset
+    bool collision_active = false;
+    glm::vec3 collision_normal = glm::vec3(0.f, 1.f, 0.f);
+    float collision_offset = 0.f, collision_restitution = 0.5f;
+
     // particle model
     unsigned int VAO = 0, VBO = 0;
     GLenum mode = GL_TRIANGLES;
@@ -262,12 +338,23 @@ private:
 
     GLenum blending_dfactor = GL_ONE_MINUS_SRC_ALPHA;
     bool use_blending = true;
+    bool oit_mode = false; // weighted blended OIT, particles are not sorted
 
     unsigned int transform_uniform_loc, color_uniform_loc, projview_uniform_loc, size_uniform_loc;
 
     void psDrawElementsBaseVertex(unsigned int shader_id);
     void psDrawPoint(unsigned int shader_id);
     void cleanVAO();
+    void emitParticle(const ParticleProps& props, const glm::vec3& origin);
+    void reserveEvents();
+    void recordEvent(std::vector<ParticleEvent>& events, const Particle& part);
+    void dispatchSubEmitters();
+    void clearEvents();
+    bool spawnsInto(ParticleSystem* target, std::vector<ParticleSystem*>& visited);
+    bool acquireParams();
+    void particleState(const Particle& particle, glm::mat4& transform, glm::vec4& color, float& size);
+
+    friend class ParticleBatch;
     // void psDrawElements(glm::mat4 projection_view_matrix);
 
 public:
@@ -308,9 +395,27 @@ public:
     bool isAccelerationActive();
     void toggleTexture(bool active);
 
+    void setOITMode(bool active);
+    bool isOITMode();
+
     void emit(const ParticleProps& props);
+    void emit(const std::vector<ParticleEvent>& events, const ParticleProps& props, int count = 1);
+
+    // the first call turns event recording on, events of the last onUpdate
+    const std::vector<ParticleEvent>& getEvents(PSevent type);
+    // rejects spawn bindings that lead back to this system, directly or through others
+    bool addSubEmitter(ParticleSystem* target, PSevent trigger, const ParticleProps& props, int count = 1);
+    void clearSubEmitters();
+
+    void setCollisionPlane(glm::vec3 normal, float offset, float restitution = 0.5f);
+    void toggleCollision(bool active);
+    bool isCollisionActive();
     void setSpawnRateVariation(float var);
 
+    // editor side, writes through these pointers take effect after commitParams()
+    void commitParams();
+    uint32_t getParamsVersion();
+
     ParticleProps* getPropsReference();
     float* getSpawnRateReference();
     float* getSpawnRateVarReference();
@@ -320,6 +425,113 @@ public:
     std::string getPropsYAML();
 };
 
+// Weighted blended order-independent transparency (McGuire & Bavoil 2013).
+// Render every system that has setOITMode(true) between begin() and end(),
+// using a fragment shader like sample_shaders/sample_oit.frag, then call
+// composite() with sample_shaders/oit_composite.* on the target framebuffer.
+// The result is an approximation of the sorted path, but it needs no sort
+// and it blends correctly across different emitters.
+class ParticleOITBuffer{
+
+private:
+
+    unsigned int FBO = 0, accum_texture = 0, revealage_texture = 0;
+    unsigned int composite_VAO = 0;
+    unsigned int depth_texture = 0;
+    int width = 0, height = 0;
+    GLint previous_FBO = 0;
+
+    // blend and depth write state of the caller, restored after each pass
+    GLboolean saved_blend = GL_FALSE, saved_depth_mask = GL_TRUE;
+    GLint saved_blend_func[4] = { GL_ONE, GL_ZERO, GL_ONE, GL_ZERO };
+
+    void saveState();
+    void restoreState();
+
+public:
+    ParticleOITBuffer();
+    ~ParticleOITBuffer();
+
+    // depth_texture is optional, it lets the opaque scene occlude the particles
+    bool create(int width, int height, unsigned int depth_texture = 0);
+    bool resize(int width, int height, unsigned int depth_texture = 0);
+    void destroy();
+
+    void begin();
+    void end();
+    void composite(unsigned int shader_id);
+};
+
+// Draws many systems whose meshes live in one combined vertex/index buffer
+// (a single VAO, see ParticleSystem::attatchVAO) with one
+// glMultiDrawElementsIndirect per frame. Each system with live particles
+// becomes one draw command, its particles are the instances of that command.
+// The shaders fetch per particle data from an SSBO at binding 0 and per
+// system data at binding 1 through gl_DrawID, see sample_shaders/sample_mdi.*
+// Point mode systems and systems with another VAO or index type are skipped.
+class ParticleBatch{
+
+public:
+
+    // layout of glMultiDrawElementsIndirect
+    struct DrawCommand{
+        GLuint count;
+        GLuint instance_count;
+        GLuint first_index;
+        GLint base_vertex;
+        GLuint base_instance;
+    };
+
+    // std430 layout, keep in sync with the shaders
+    struct InstanceData{
+        glm::mat4 transform;
+        glm::vec4 color;
+        glm::vec4 size; // x: size, yzw: unused
+    };
+
+    struct EmitterData{
+        GLuint instance_base;
+        GLuint instance_count;
+        GLuint padding[2];
+    };
+
+private:
+
+    unsigned int VAO = 0;
+    GLenum mode = GL_TRIANGLES;
+    GLenum indices_type = GL_UNSIGNED_INT;
+
+    unsigned int indirect_buffer = 0, instance_buffer = 0, emitter_buffer = 0;
+    GLsizeiptr indirect_capacity = 0, instance_capacity = 0, emitter_capacity = 0;
+
+    std::vector<ParticleSystem*> systems;
+
+    // rebuilt every frame, the vectors keep their capacity
+    std::vector<DrawCommand> commands;
+    std::vector<InstanceData> instances;
+    std::vector<EmitterData> emitters;
+
+    unsigned int projview_uniform_loc;
+
+    bool accepts(ParticleSystem* system);
+    void upload(GLenum target, unsigned int& buffer, GLsizeiptr& capacity, const void* data, GLsizeiptr size);
+    void destroy();
+
+public:
+    ParticleBatch();
+    ~ParticleBatch();
+
+    void attatchVAO(unsigned int VAO, GLenum type = GL_UNSIGNED_INT);
+    void setRenderMode(GLenum mode);
+
+    bool addSystem(ParticleSystem* system);
+    void removeSystem(ParticleSystem* system);
+    void clearSystems();
+
+    void onRender(unsigned int shader_id, glm::mat4 projection_view_matrix);
+    GLsizei getDrawCount();
+};
+
 bool compareParticles(const ParticleSystem::Particle& obj1, const ParticleSystem::Particle& obj2);
 
 #endif // Header
@@ -445,7 +657,8 @@ void ParticleSystem::attatchVAO(unsigned int VAO, GLsizei count, GLenum type, vo
 }
 
 void ParticleSystem::attatchProps(const ParticleProps &props){
-    this->props = props; 
+    edit_params.props = props;
+    this->commitParams();
 }
 
 void ParticleSystem::attatchTexture(unsigned int texture_id){
@@ -462,11 +675,24 @@ bool ParticleSystem::getUseTexture(){
 
 void ParticleSystem::onUpdate(float time_step, glm::vec3 camera_position){
     
-    if(!playing)
+    // frame boundary, pick up the last properties published by the editor
+    this->acquireParams();
+
+    // copies do not keep the reserved capacity
+    if( events_enabled )
+        this->reserveEvents();
+
+    // a paused system still receives particles from other sub emitters
+    if(!playing){
+        this->clearEvents();
         return;
+    }
     
     time_step *= reproduction_speed;
 
+    // last frame events feed the sub emitters, then the buffers start over
+    this->dispatchSubEmitters();
+
     curr_spawn_rate -= time_step;
     if(curr_spawn_rate < 0){
         this->emit(this->props);
@@ -488,12 +714,29 @@ void ParticleSystem::onUpdate(float time_step, glm::vec3 camera_position){
 
         if(acceleration_active)
             part.velocity += part.acceleration_sensitivity * part.acceleration * time_step;
+
+        if( collision_active ){
+            float penetration = glm::dot(collision_normal, part.position) - collision_offset;
+            if( penetration < 0.f && glm::dot(collision_normal, part.velocity) < 0.f ){
+                // bounce, restitution only scales the normal component
+                part.position -= penetration * collision_normal;
+                part.velocity -= (1.f + collision_restitution) * glm::dot(collision_normal, part.velocity) * collision_normal;
+                recordEvent(collision_events, part);
+            }
+        }
+
+        if( part.life_remaining <= 0.f )
+            recordEvent(death_events, part);
         
         part.distance_from_camera = glm::distance(part.position, camera_position);
         // part.rotation += 0.01f * time_step;
 
     }
 
+    // the OIT path does not depend on the drawing order
+    if( oit_mode )
+        return;
+
     if( this->blending_dfactor == GL_SRC_ALPHA || this->blending_dfactor == GL_ONE_MINUS_SRC_ALPHA)
         std::sort(particle_pool.begin(), particle_pool.end(), compareParticles);
 
@@ -525,18 +768,12 @@ void ParticleSystem::onRender(unsigned int shader_id, glm::mat4 projection_view_
 		if (!particle.active)
 			continue;
 
-		// Fade away particles
-		float life = particle.life_remaining / particle.life_time;
-		glm::vec4 color = glm::lerp(particle.color_end, particle.color_begin, life);
-		//color.a = color.a * life;
+		glm::mat4 transform;
+		glm::vec4 color;
+		float size;
+		particleState(particle, transform, color, size);
 
-		float size = glm::lerp(particle.size_end, particle.size_begin, life);
-		
 		// Render
-		glm::mat4 transform = glm::translate(glm::mat4(1.0f), particle.position)
-			* glm::rotate(glm::mat4(1.0f), particle.rotation, { 0.0f, 0.0f, 1.0f })
-			* glm::scale(glm::mat4(1.0f), { size, size, 1.0f });
-
 		glUniformMatrix4fv(transform_uniform_loc, 1, GL_FALSE, glm::value_ptr(transform));
 		glUniform4fv(color_uniform_loc, 1, glm::value_ptr(color));
         glUniform1f(size_uniform_loc, size);
@@ -557,6 +794,19 @@ void ParticleSystem::onRender(unsigned int shader_id, glm::mat4 projection_view_
 
 }
 
+void ParticleSystem::particleState(const Particle &particle, glm::mat4 &transform, glm::vec4 &color, float &size){
+    // Fade away particles
+    float life = particle.life_remaining / particle.life_time;
+    color = glm::lerp(particle.color_end, particle.color_begin, life);
+    //color.a = color.a * life;
+
+    size = glm::lerp(particle.size_end, particle.size_begin, life);
+
+    transform = glm::translate(glm::mat4(1.0f), particle.position)
+        * glm::rotate(glm::mat4(1.0f), particle.rotation, { 0.0f, 0.0f, 1.0f })
+        * glm::scale(glm::mat4(1.0f), { size, size, 1.0f });
+}
+
 void ParticleSystem::pause(){
     this->playing = false;
 }
@@ -574,7 +824,8 @@ bool ParticleSystem::isPlaying(){
 }
 
 void ParticleSystem::setReproductionSpeed(float speed){
-    this->reproduction_speed = speed;
+    edit_params.reproduction_speed = speed;
+    this->commitParams();
 }
 
 void ParticleSystem::setRenderMode(GLenum mode){
@@ -651,12 +902,32 @@ void ParticleSystem::toggleTexture(bool active){
     use_texture = active;
 }
 
+void ParticleSystem::setOITMode(bool active){
+    oit_mode = active;
+}
+
+bool ParticleSystem::isOITMode(){
+    return this->oit_mode;
+}
+
 void ParticleSystem::emit(const ParticleProps &props){
+    this->emitParticle(props, props.position);
+}
+
+void ParticleSystem::emit(const std::vector<ParticleEvent> &events, const ParticleProps &props, int count){
+    for(const ParticleEvent& event : events){
+        glm::vec3 origin = event.position + props.position;
+        for(int j = 0; j < count; j++)
+            this->emitParticle(props, origin);
+    }
+}
+
+void ParticleSystem::emitParticle(const ParticleProps &props, const glm::vec3 &origin){
 
     Particle& part = this->particle_pool[pool_index];
     part.active = true;
 
-    part.position = props.position;
+    part.position = origin;
     part.position.x += glm::lerp(props.boundaries[0].x, props.boundaries[1].x, RANDOM_VAL);
     part.position.y += glm::lerp(props.boundaries[0].y, props.boundaries[1].y, RANDOM_VAL);
     part.position.z += glm::lerp(props.boundaries[0].z, props.boundaries[1].z, RANDOM_VAL);
@@ -692,31 +963,184 @@ void ParticleSystem::emit(const ParticleProps &props){
     part.size_end = props.size_end;
     part.acceleration_sensitivity = props.acceleration_sensitivity;
 
+    recordEvent(spawn_events, part);
+
     pool_index = --pool_index % particle_pool.size();
 }
 
+void ParticleSystem::reserveEvents(){
+    if( spawn_events.capacity() >= particle_pool.size() && dispatched_spawn_events.capacity() >= particle_pool.size() )
+        return;
+
+    spawn_events.reserve(particle_pool.size());
+    death_events.reserve(particle_pool.size());
+    collision_events.reserve(particle_pool.size());
+    dispatched_spawn_events.reserve(particle_pool.size());
+    dispatched_death_events.reserve(particle_pool.size());
+    dispatched_collision_events.reserve(particle_pool.size());
+}
+
+void ParticleSystem::recordEvent(std::vector<ParticleEvent> &events, const Particle &part){
+    if( events_enabled && events.size() < particle_pool.size() )
+        events.push_back({part.position, part.velocity});
+}
+
+void ParticleSystem::dispatchSubEmitters(){
+    if( sub_emitters.empty() ){
+        this->clearEvents();
+        return;
+    }
+
+    // swap first, so spawns caused by a binding targeting this same system
+    // land in the fresh buffers and are seen next frame
+    spawn_events.swap(dispatched_spawn_events);
+    death_events.swap(dispatched_death_events);
+    collision_events.swap(dispatched_collision_events);
+    this->clearEvents();
+
+    for(SubEmitter& sub : sub_emitters){
+        if( sub.trigger == PS_EVENT_DEATH )
+            sub.target->emit(dispatched_death_events, sub.props, sub.count);
+        else if( sub.trigger == PS_EVENT_COLLISION )
+            sub.target->emit(dispatched_collision_events, sub.props, sub.count);
+        else
+            sub.target->emit(dispatched_spawn_events, sub.props, sub.count);
+    }
+
+    dispatched_spawn_events.clear();
+    dispatched_death_events.clear();
+    dispatched_collision_events.clear();
+}
+
+void ParticleSystem::clearEvents(){
+    spawn_events.clear();
+    death_events.clear();
+    collision_events.clear();
+}
+
+const std::vector<ParticleSystem::ParticleEvent> &ParticleSystem::getEvents(PSevent type){
+    if( !events_enabled ){
+        events_enabled = true;
+        this->reserveEvents();
+    }
+
+    if( type == PS_EVENT_DEATH )
+        return this->death_events;
+    if( type == PS_EVENT_COLLISION )
+        return this->collision_events;
+    return this->spawn_events;
+}
+
+bool ParticleSystem::addSubEmitter(ParticleSystem *target, PSevent trigger, const ParticleProps &props, int count){
+    // a chain of spawn bindings leading back here would feed itself every frame
+    std::vector<ParticleSystem*> visited;
+    if( target == nullptr || (trigger == PS_EVENT_SPAWN && target->spawnsInto(this, visited)) ){
+        std::cerr << "stb_particle_system addSubEmitter\ninvalid target for this trigger" << std::endl;
+        return false;
+    }
+
+    if( !events_enabled ){
+        events_enabled = true;
+        this->reserveEvents();
+    }
+
+    SubEmitter sub;
+    sub.target = target;
+    sub.trigger = trigger;
+    sub.props = props;
+    sub.count = count;
+    sub_emitters.push_back(sub);
+    return true;
+}
+
+bool ParticleSystem::spawnsInto(ParticleSystem *target, std::vector<ParticleSystem*> &visited){
+    if( this == target )
+        return true;
+    if( std::find(visited.begin(), visited.end(), this) != visited.end() )
+        return false;
+    visited.push_back(this);
+
+    for(SubEmitter& sub : sub_emitters)
+        if( sub.trigger == PS_EVENT_SPAWN && sub.target->spawnsInto(target, visited) )
+            return true;
+
+    return false;
+}
+
+void ParticleSystem::clearSubEmitters(){
+    sub_emitters.clear();
+}
+
+void ParticleSystem::setCollisionPlane(glm::vec3 normal, float offset, float restitution){
+    this->collision_normal = glm::normalize(normal);
+    this->collision_offset = offset;
+    this->collision_restitution = restitution;
+}
+
+void ParticleSystem::toggleCollision(bool active){
+    collision_active = active;
+}
+
+bool ParticleSystem::isCollisionActive(){
+    return this->collision_active;
+}
+
 void ParticleSystem::setSpawnRateVariation(float var){
-    this->spawn_rate_variation = var;
+    edit_params.spawn_rate_variation = var;
+    this->commitParams();
+}
+
+void ParticleSystem::commitParams(){
+    edit_params.version++;
+    ParamsExchange& exchange = this->params_exchange;
+    exchange.slots[exchange.back_slot] = edit_params;
+    exchange.back_slot = exchange.middle_slot.exchange(exchange.back_slot | PARAMS_FRESH, std::memory_order_acq_rel) & ~PARAMS_FRESH;
+}
+
+bool ParticleSystem::acquireParams(){
+    ParamsExchange& exchange = this->params_exchange;
+    if( !(exchange.middle_slot.load(std::memory_order_relaxed) & PARAMS_FRESH) )
+        return false;
+
+    exchange.front_slot = exchange.middle_slot.exchange(exchange.front_slot, std::memory_order_acq_rel) & ~PARAMS_FRESH;
+    const EmitterParams& params = exchange.slots[exchange.front_slot];
+
+    // only re-bake what depends on a value that changed
+    if( params.spawn_rate != spawn_rate && curr_spawn_rate > params.spawn_rate )
+        curr_spawn_rate = params.spawn_rate;
+
+    this->props = params.props;
+    this->spawn_rate = params.spawn_rate;
+    this->spawn_rate_variation = params.spawn_rate_variation;
+    this->reproduction_speed = params.reproduction_speed;
+    this->point_size = params.point_size;
+    exchange.applied_version.store(params.version, std::memory_order_release);
+
+    return true;
+}
+
+uint32_t ParticleSystem::getParamsVersion(){
+    return this->params_exchange.applied_version.load(std::memory_order_acquire);
 }
 
 ParticleProps *ParticleSystem::getPropsReference(){
-    return &this->props;
+    return &this->edit_params.props;
 }
 
 float *ParticleSystem::getSpawnRateReference(){
-    return &this->spawn_rate;
+    return &this->edit_params.spawn_rate;
 }
 
 float *ParticleSystem::getSpawnRateVarReference(){
-    return &this->spawn_rate_variation;
+    return &this->edit_params.spawn_rate_variation;
 }
 
 float *ParticleSystem::getReproductionSpeedReference(){
-    return &this->reproduction_speed;
+    return &this->edit_params.reproduction_speed;
 }
 
 float *ParticleSystem::getPointSizeReference(){
-    return &this->point_size;
+    return &this->edit_params.point_size;
 }
 
 bool ParticleSystem::useBlending(){
@@ -724,7 +1148,311 @@ bool ParticleSystem::useBlending(){
 }
 
 std::string ParticleSystem::getPropsYAML(){
-    return ParticleProps::toString(this->props);
+    return ParticleProps::toString(this->edit_params.props);
+}
+
+ParticleOITBuffer::ParticleOITBuffer(){
+}
+
+ParticleOITBuffer::~ParticleOITBuffer(){
+    this->destroy();
+}
+
+bool ParticleOITBuffer::create(int width, int height, unsigned int depth_texture){
+    GLenum error;
+
+    this->destroy();
+    this->width = width;
+    this->height = height;
+    this->depth_texture = depth_texture;
+
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous_FBO);
+
+    glGenFramebuffers(1, &this->FBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, this->FBO);
+
+    // accumulation: premultiplied color * weight, and alpha * weight
+    glGenTextures(1, &this->accum_texture);
+    glBindTexture(GL_TEXTURE_2D, this->accum_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->accum_texture, 0);
+
+    // revealage: product of (1 - alpha) of every fragment
+    glGenTextures(1, &this->revealage_texture);
+    glBindTexture(GL_TEXTURE_2D, this->revealage_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, this->revealage_texture, 0);
+
+    if( depth_texture != 0 )
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_texture, 0);
+
+    GLenum draw_buffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, draw_buffers);
+
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    if( !complete )
+        std::cerr << "stb_particle_system ParticleOITBuffer::create\nincomplete framebuffer" << std::endl;
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, previous_FBO);
+
+    // the composite pass generates a full screen triangle from gl_VertexID
+    glGenVertexArrays(1, &this->composite_VAO);
+
+    error = glGetError();
+    if (error != GL_NO_ERROR) 
+        std::cerr << "stb_particle_system ParticleOITBuffer::create\nOpenGL error: " << error << std::endl;
+
+    return complete;
+}
+
+bool ParticleOITBuffer::resize(int width, int height, unsigned int depth_texture){
+    if( this->FBO != 0 && this->width == width && this->height == height && this->depth_texture == depth_texture )
+        return true;
+    return this->create(width, height, depth_texture);
+}
+
+void ParticleOITBuffer::destroy(){
+    if( this->FBO != 0 ){
+        glDeleteFramebuffers(1, &this->FBO);
+        glDeleteTextures(1, &this->accum_texture);
+        glDeleteTextures(1, &this->revealage_texture);
+        glDeleteVertexArrays(1, &this->composite_VAO);
+        this->FBO = 0;
+        this->accum_texture = 0;
+        this->revealage_texture = 0;
+        this->composite_VAO = 0;
+        this->depth_texture = 0;
+    }
+}
+
+void ParticleOITBuffer::saveState(){
+    saved_blend = glIsEnabled(GL_BLEND);
+    glGetBooleanv(GL_DEPTH_WRITEMASK, &saved_depth_mask);
+    glGetIntegerv(GL_BLEND_SRC_RGB, &saved_blend_func[0]);
+    glGetIntegerv(GL_BLEND_DST_RGB, &saved_blend_func[1]);
+    glGetIntegerv(GL_BLEND_SRC_ALPHA, &saved_blend_func[2]);
+    glGetIntegerv(GL_BLEND_DST_ALPHA, &saved_blend_func[3]);
+}
+
+void ParticleOITBuffer::restoreState(){
+    // glBlendFuncSeparate also resets the per draw buffer functions set in begin()
+    glBlendFuncSeparate(saved_blend_func[0], saved_blend_func[1], saved_blend_func[2], saved_blend_func[3]);
+
+    if( saved_blend )
+        glEnable(GL_BLEND);
+    else
+        glDisable(GL_BLEND);
+
+    glDepthMask(saved_depth_mask);
+}
+
+void ParticleOITBuffer::begin(){
+    GLfloat accum_clear[4] = { 0.f, 0.f, 0.f, 0.f };
+    GLfloat revealage_clear[4] = { 1.f, 1.f, 1.f, 1.f };
+
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous_FBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, this->FBO);
+
+    this->saveState();
+
+    glClearBufferfv(GL_COLOR, 0, accum_clear);
+    glClearBufferfv(GL_COLOR, 1, revealage_clear);
+
+    // test against the opaque depth, but never write it
+    glDepthMask(GL_FALSE);
+
+    glEnable(GL_BLEND);
+    glBlendFunci(0, GL_ONE, GL_ONE);
+    glBlendFunci(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+}
+
+void ParticleOITBuffer::end(){
+    this->restoreState();
+    glBindFramebuffer(GL_FRAMEBUFFER, previous_FBO);
+}
+
+void ParticleOITBuffer::composite(unsigned int shader_id){
+    GLenum error;
+
+    glUseProgram(shader_id);
+    glUniform1i(glGetUniformLocation(shader_id, "u_Accum"), 0);
+    glUniform1i(glGetUniformLocation(shader_id, "u_Revealage"), 1);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, this->accum_texture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, this->revealage_texture);
+
+    GLboolean depth_test = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+
+    this->saveState();
+
+    // the composite shader outputs alpha = 1 - revealage
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    glBindVertexArray(this->composite_VAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    error = glGetError();
+    if (error != GL_NO_ERROR) 
+        std::cerr << "stb_particle_system ParticleOITBuffer::composite\nOpenGL error: " << error << std::endl;
+
+    this->restoreState();
+
+    if( depth_test )
+        glEnable(GL_DEPTH_TEST);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+ParticleBatch::ParticleBatch(){
+}
+
+ParticleBatch::~ParticleBatch(){
+    this->destroy();
+}
+
+bool ParticleBatch::accepts(ParticleSystem *system){
+    return !system->point_mode
+        && system->VAO == this->VAO
+        && system->indices_type == this->indices_type;
+}
+
+void ParticleBatch::upload(GLenum target, unsigned int &buffer, GLsizeiptr &capacity, const void *data, GLsizeiptr size){
+    if( buffer == 0 )
+        glGenBuffers(1, &buffer);
+
+    glBindBuffer(target, buffer);
+
+    // grow by doubling, orphaning the old storage avoids waiting on the GPU
+    if( size > capacity )
+        capacity = std::max(size, 2 * capacity);
+    glBufferData(target, capacity, nullptr, GL_STREAM_DRAW);
+
+    glBufferSubData(target, 0, size, data);
+}
+
+void ParticleBatch::destroy(){
+    if( indirect_buffer != 0 )
+        glDeleteBuffers(1, &indirect_buffer);
+    if( instance_buffer != 0 )
+        glDeleteBuffers(1, &instance_buffer);
+    if( emitter_buffer != 0 )
+        glDeleteBuffers(1, &emitter_buffer);
+
+    indirect_buffer = instance_buffer = emitter_buffer = 0;
+    indirect_capacity = instance_capacity = emitter_capacity = 0;
+}
+
+void ParticleBatch::attatchVAO(unsigned int VAO, GLenum type){
+    this->VAO = VAO;
+    this->indices_type = type;
+}
+
+void ParticleBatch::setRenderMode(GLenum mode){
+    this->mode = mode;
+}
+
+bool ParticleBatch::addSystem(ParticleSystem *system){
+    if( !accepts(system) ){
+        std::cerr << "stb_particle_system ParticleBatch::addSystem\nsystem does not share the batch VAO or index type" << std::endl;
+        return false;
+    }
+    systems.push_back(system);
+    return true;
+}
+
+void ParticleBatch::removeSystem(ParticleSystem *system){
+    systems.erase(std::remove(systems.begin(), systems.end(), system), systems.end());
+}
+
+void ParticleBatch::clearSystems(){
+    systems.clear();
+}
+
+void ParticleBatch::onRender(unsigned int shader_id, glm::mat4 projection_view_matrix){
+    GLenum error;
+
+    commands.clear();
+    instances.clear();
+    emitters.clear();
+
+    GLuint index_size = indices_type == GL_UNSIGNED_BYTE ? 1 : indices_type == GL_UNSIGNED_SHORT ? 2 : 4;
+
+    for(ParticleSystem* system : systems){
+        // the system may have been pointed to another mesh since addSystem
+        if( !accepts(system) )
+            continue;
+
+        GLuint instance_base = (GLuint) instances.size();
+
+        for(ParticleSystem::Particle& particle : system->particle_pool){
+            if( !particle.active )
+                continue;
+
+            InstanceData instance;
+            float size;
+            system->particleState(particle, instance.transform, instance.color, size);
+            instance.size = glm::vec4(size, 0.f, 0.f, 0.f);
+            instances.push_back(instance);
+        }
+
+        GLuint instance_count = (GLuint) instances.size() - instance_base;
+        if( instance_count == 0 )
+            continue;
+
+        DrawCommand command;
+        command.count = system->indices_count;
+        command.instance_count = instance_count;
+        command.first_index = (GLuint) ((uintptr_t) system->indices / index_size);
+        command.base_vertex = system->basevertex;
+        command.base_instance = instance_base;
+        commands.push_back(command);
+
+        EmitterData emitter;
+        emitter.instance_base = instance_base;
+        emitter.instance_count = instance_count;
+        emitter.padding[0] = emitter.padding[1] = 0;
+        emitters.push_back(emitter);
+    }
+
+    if( commands.empty() )
+        return;
+
+    upload(GL_SHADER_STORAGE_BUFFER, instance_buffer, instance_capacity, instances.data(), instances.size() * sizeof(InstanceData));
+    upload(GL_SHADER_STORAGE_BUFFER, emitter_buffer, emitter_capacity, emitters.data(), emitters.size() * sizeof(EmitterData));
+    upload(GL_DRAW_INDIRECT_BUFFER, indirect_buffer, indirect_capacity, commands.data(), commands.size() * sizeof(DrawCommand));
+
+    glUseProgram(shader_id);
+
+    projview_uniform_loc = glGetUniformLocation(shader_id, "u_ProjView");
+    glUniformMatrix4fv(projview_uniform_loc, 1, GL_FALSE, glm::value_ptr(projection_view_matrix));
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instance_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, emitter_buffer);
+
+    glBindVertexArray(this->VAO);
+    glMultiDrawElementsIndirect(this->mode, this->indices_type, nullptr, (GLsizei) commands.size(), 0);
+
+    error = glGetError();
+    if (error != GL_NO_ERROR) 
+        std::cerr << "stb_particle_system ParticleBatch::onRender\nOpenGL error: " << error << std::endl;
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+GLsizei ParticleBatch::getDrawCount(){
+    return (GLsizei) this->commands.size();
 }
 
 // Define a custom comparison function based on your sorting criterion